@@ -31,7 +31,7 @@ static void set_session_cookie(http_response* res, const char* sid) {
     int n = snprintf(header, sizeof header,
         "Set-Cookie: %s=%s; Path=/; HttpOnly; SameSite=%s%s\r\n",
         name, sid, samesite, secure?"; Secure":"");
-    send(res->fd, header, n, 0);
+    http_write(res, header, (size_t)n);
 }
 
 static void clear_session_cookie(http_response* res) {
@@ -42,7 +42,7 @@ static void clear_session_cookie(http_response* res) {
     int n = snprintf(header, sizeof header,
         "Set-Cookie: %s=deleted; Path=/; HttpOnly; Max-Age=0; SameSite=%s%s\r\n",
         name, samesite, secure?"; Secure":"");
-    send(res->fd, header, n, 0);
+    http_write(res, header, (size_t)n);
 }
 
 static int parse_cookie_for_session(const char* cookie_header, char out_sid[128]) {
@@ -0,0 +1,102 @@
+// src/cache.c
+#define _POSIX_C_SOURCE 200809L
+#include "cache.h"
+#include "sessions.h"
+#include <hiredis/hiredis.h>
+#include <sodium.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Keys:
+ *   vehicles_ver:<uid>  counter, INCR'd by every write to the user's vehicles;
+ *                       expires after twice the entry TTL (a lost counter only
+ *                       turns into a miss, see cache_vehicles_bump)
+ *   vehicles:<uid>      hash {ver, etag, body}, valid only while ver matches
+ * A reader snapshots the version before querying Postgres, so an entry built
+ * from rows that a concurrent write has since changed is never served.
+ */
+
+static int TTL = 3600;
+
+void cache_init(void) {
+    const char* v = getenv("VEHICLES_CACHE_TTL_SECONDS");
+    if (v && *v) TTL = atoi(v);
+}
+
+void cache_etag_for(const char* body, size_t len, char out[CACHE_ETAG_LEN]) {
+    unsigned char h[16];
+    crypto_generichash(h, sizeof h, (const unsigned char*)body, len, NULL, 0);
+    out[0] = '"';
+    sodium_bin2hex(out + 1, 33, h, sizeof h);
+    out[33] = '"'; out[34] = '\0';
+}
+
+/* Returns 0 on hit (caller frees *out_json), -1 on miss. On a miss *out_ver
+   holds the version to store the rebuilt entry under, or -1 if Redis is unavailable. */
+int cache_vehicles_get(const char* user_id, long long* out_ver, char** out_json, char out_etag[CACHE_ETAG_LEN]) {
+    redisContext* rc = sessions_conn();
+    *out_ver = -1; *out_json = NULL;
+    if (!rc || TTL <= 0) return -1;
+
+    redisAppendCommand(rc, "GET vehicles_ver:%s", user_id);
+    redisAppendCommand(rc, "HMGET vehicles:%s ver etag body", user_id);
+    redisReply* ver = NULL; redisReply* ent = NULL;
+    if (redisGetReply(rc, (void**)&ver) != REDIS_OK) return -1;
+    if (redisGetReply(rc, (void**)&ent) != REDIS_OK) { freeReplyObject(ver); return -1; }
+
+    long long cur = 0;
+    if (ver->type == REDIS_REPLY_STRING) cur = strtoll(ver->str, NULL, 10);
+    else if (ver->type != REDIS_REPLY_NIL) { freeReplyObject(ver); freeReplyObject(ent); return -1; }
+    *out_ver = cur;
+
+    int rc_out = -1;
+    if (ent->type == REDIS_REPLY_ARRAY && ent->elements == 3 &&
+        ent->element[0]->type == REDIS_REPLY_STRING &&
+        ent->element[1]->type == REDIS_REPLY_STRING &&
+        ent->element[2]->type == REDIS_REPLY_STRING &&
+        strtoll(ent->element[0]->str, NULL, 10) == cur &&
+        ent->element[1]->len == CACHE_ETAG_LEN - 1) {
+        char* body = malloc(ent->element[2]->len + 1);
+        if (body) {
+            memcpy(body, ent->element[2]->str, ent->element[2]->len);
+            body[ent->element[2]->len] = '\0';
+            memcpy(out_etag, ent->element[1]->str, CACHE_ETAG_LEN);
+            *out_json = body;
+            rc_out = 0;
+        }
+    }
+    freeReplyObject(ver);
+    freeReplyObject(ent);
+    return rc_out;
+}
+
+void cache_vehicles_put(const char* user_id, long long ver, const char* json, const char* etag) {
+    redisContext* rc = sessions_conn();
+    if (!rc || ver < 0 || TTL <= 0) return;
+    redisAppendCommand(rc, "HSET vehicles:%s ver %lld etag %s body %b",
+                       user_id, ver, etag, json, strlen(json));
+    redisAppendCommand(rc, "EXPIRE vehicles:%s %d", user_id, TTL);
+    for (int i = 0; i < 2; i++) {
+        redisReply* r = NULL;
+        if (redisGetReply(rc, (void**)&r) != REDIS_OK) return;
+        freeReplyObject(r);
+    }
+}
+
+/* Call after any insert/update/delete touching the user's vehicles. The DEL
+   covers the case where the counter itself was evicted and restarts at 0. */
+void cache_vehicles_bump(const char* user_id) {
+    redisContext* rc = sessions_conn();
+    if (!rc) return;
+    // still bumped with the cache disabled, so re-enabling it never serves an old entry
+    redisAppendCommand(rc, "INCR vehicles_ver:%s", user_id);
+    redisAppendCommand(rc, "EXPIRE vehicles_ver:%s %d", user_id, 2*(TTL > 0 ? TTL : 3600));
+    redisAppendCommand(rc, "DEL vehicles:%s", user_id);
+    for (int i = 0; i < 3; i++) {
+        redisReply* r = NULL;
+        if (redisGetReply(rc, (void**)&r) != REDIS_OK) return;
+        freeReplyObject(r);
+    }
+}
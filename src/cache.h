@@ -0,0 +1,14 @@
+// src/cache.h
+#pragma once
+#include <stddef.h>
+
+/* Strong ETag: two quotes + 32 hex chars + NUL */
+#define CACHE_ETAG_LEN 35
+
+void cache_etag_for(const char* body, size_t len, char out[CACHE_ETAG_LEN]);
+
+/* Per-user GET /api/vehicles response cache (Redis). */
+void cache_init(void);
+int  cache_vehicles_get(const char* user_id, long long* out_ver, char** out_json, char out_etag[CACHE_ETAG_LEN]);
+void cache_vehicles_put(const char* user_id, long long ver, const char* json, const char* etag);
+void cache_vehicles_bump(const char* user_id);
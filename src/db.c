@@ -2,38 +2,135 @@
 #define _POSIX_C_SOURCE 200809L
 #include "db.h"
 #include "util.h"
+#include "cache.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
-static PGconn* g_conn = NULL;
+static PGconn* g_conn = NULL;          /* primary: writes */
+static PGconn* g_primary_read = NULL;  /* primary: sticky and fallback reads, all reads without a replica */
+static PGconn* g_replica = NULL;       /* optional read replica (PGREPLICA_HOST) */
+
+/* Statement classes, each with its own statement_timeout budget. The budgets
+   are connection defaults (read connections: read, g_conn: write), so routing
+   costs no extra round trip; bulk loads raise theirs with SET LOCAL. */
+typedef enum { DB_READ, DB_WRITE, DB_BULK, DB_NCLASSES } db_class;
+static int g_budget_ms[DB_NCLASSES] = { 500, 2000, 30000 };
+
+/* Connects and resets block the event loop, so they are bounded by
+   connect_timeout, and a down replica is retried at most every DB_REPLICA_RETRY_MS. */
+static int g_connect_timeout_s = 2;
+static int g_replica_retry_ms = 10000;
+static long long g_replica_retry_at = 0;
+
+/* Read-your-writes: after a write, the user's reads go to the primary for
+   DB_STICKY_MS. Slots are keyed by hash only and hold the latest expiry, so a
+   collision can only send extra reads to the primary, never a stale one. */
+#define DB_STICKY_SLOTS 4096
+static long long g_sticky[DB_STICKY_SLOTS];
+static int g_sticky_ms = 5000;
 
 static const char* getenv_or(const char* k, const char* d) {
     const char* v = getenv(k); return (v && *v) ? v : d;
 }
 
-int db_init(void) {
-    const char* host = getenv_or("PGHOST", NULL);
-    const char* port = getenv_or("PGPORT", NULL);
+static PGconn* db_connect(const char* host, const char* port, int statement_timeout_ms) {
     const char* db   = getenv_or("PGDATABASE", NULL);
     const char* user = getenv_or("PGUSER", NULL);
     const char* pass = getenv_or("PGPASSWORD", NULL);
 
     char conninfo[1024] = {0};
     snprintf(conninfo, sizeof conninfo,
-        "host=%s port=%s dbname=%s user=%s password=%s",
-        host?host:"", port?port:"", db?db:"", user?user:"", pass?pass:"");
+        "host=%s port=%s dbname=%s user=%s password=%s "
+        "connect_timeout=%d keepalives=1 keepalives_idle=30 keepalives_interval=10 keepalives_count=3 "
+        "tcp_user_timeout=%d options='-c statement_timeout=%d'",
+        host?host:"", port?port:"", db?db:"", user?user:"", pass?pass:"",
+        g_connect_timeout_s, g_connect_timeout_s*1000, statement_timeout_ms);
+    return PQconnectdb(conninfo);
+}
+
+static long long now_ms(void) {
+    struct timespec ts; clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec*1000 + ts.tv_nsec/1000000;
+}
+
+static size_t sticky_slot(const char* user_id) {
+    unsigned long long h = 1469598103934665603ULL;
+    for (const char* p = user_id; *p; p++) { h ^= (unsigned char)*p; h *= 1099511628211ULL; }
+    return (size_t)(h % DB_STICKY_SLOTS);
+}
 
-    g_conn = PQconnectdb(conninfo);
+static void sticky_mark(const char* user_id) {
+    if (!g_replica || !user_id) return;
+    long long until = now_ms() + g_sticky_ms;
+    size_t i = sticky_slot(user_id);
+    if (g_sticky[i] < until) g_sticky[i] = until;
+}
+
+static int sticky_active(const char* user_id) {
+    return user_id && g_sticky[sticky_slot(user_id)] > now_ms();
+}
+
+static PGconn* db_primary(db_class cls) {
+    PGconn* c = cls == DB_READ ? g_primary_read : g_conn;
+    if (PQstatus(c) != CONNECTION_OK) PQreset(c);
+    return c;
+}
+
+static int replica_up(void) {
+    if (PQstatus(g_replica) == CONNECTION_OK) return 1;
+    long long now = now_ms();
+    if (now < g_replica_retry_at) return 0;
+    PQreset(g_replica);
+    if (PQstatus(g_replica) == CONNECTION_OK) return 1;
+    g_replica_retry_at = now + g_replica_retry_ms;
+    return 0;
+}
+
+/* Reads go to the replica unless the user is sticky or the replica is down. */
+static PGconn* db_for(db_class cls, const char* user_id) {
+    if (cls == DB_READ && g_replica && !sticky_active(user_id) && replica_up()) return g_replica;
+    return db_primary(cls);
+}
+
+int db_init(void) {
+    g_budget_ms[DB_READ]  = atoi(getenv_or("DB_BUDGET_READ_MS", "500"));
+    g_budget_ms[DB_WRITE] = atoi(getenv_or("DB_BUDGET_WRITE_MS", "2000"));
+    g_budget_ms[DB_BULK]  = atoi(getenv_or("DB_BUDGET_BULK_MS", "30000"));
+    g_sticky_ms = atoi(getenv_or("DB_STICKY_MS", "5000"));
+    g_connect_timeout_s = atoi(getenv_or("DB_CONNECT_TIMEOUT_S", "2"));
+    g_replica_retry_ms  = atoi(getenv_or("DB_REPLICA_RETRY_MS", "10000"));
+
+    g_conn = db_connect(getenv_or("PGHOST", NULL), getenv_or("PGPORT", NULL), g_budget_ms[DB_WRITE]);
     if (PQstatus(g_conn) != CONNECTION_OK) {
         fprintf(stderr, "Postgres connect failed: %s\n", PQerrorMessage(g_conn));
         return -1;
     }
+    g_primary_read = db_connect(getenv_or("PGHOST", NULL), getenv_or("PGPORT", NULL), g_budget_ms[DB_READ]);
+    if (PQstatus(g_primary_read) != CONNECTION_OK) {
+        fprintf(stderr, "Postgres connect failed: %s\n", PQerrorMessage(g_primary_read));
+        return -1;
+    }
+
+    const char* rhost = getenv_or("PGREPLICA_HOST", NULL);
+    if (rhost) {
+        g_replica = db_connect(rhost, getenv_or("PGREPLICA_PORT", getenv_or("PGPORT", NULL)), g_budget_ms[DB_READ]);
+        if (PQstatus(g_replica) != CONNECTION_OK) {
+            // not fatal: reads use the primary until a later retry succeeds
+            g_replica_retry_at = now_ms() + g_replica_retry_ms;
+            fprintf(stderr, "Postgres replica connect failed: %s\n", PQerrorMessage(g_replica));
+        }
+    }
     return 0;
 }
 
 void db_close(void) {
+    if (g_replica) PQfinish(g_replica);
+    if (g_primary_read) PQfinish(g_primary_read);
     if (g_conn) PQfinish(g_conn);
+    g_replica = NULL;
+    g_primary_read = NULL;
     g_conn = NULL;
 }
 
@@ -42,7 +139,7 @@ PGconn* db_conn(void) { return g_conn; }
 int db_user_create(const char* email, const char* password_hash, const char* role, char out_id[37]) {
     char uuid[37]; uuid4(uuid);
     const char* params[4] = { uuid, email, password_hash, role };
-    PGresult* r = PQexecParams(g_conn,
+    PGresult* r = PQexecParams(db_for(DB_WRITE, NULL),
         "insert into users(id,email,password_hash,role) values($1,$2,$3,$4) returning id",
         4, NULL, params, NULL, NULL, 0);
     if (PQresultStatus(r) != PGRES_TUPLES_OK) {
@@ -52,14 +149,21 @@ int db_user_create(const char* email, const char* password_hash, const char* rol
     strncpy(out_id, PQgetvalue(r, 0, 0), 36);
     out_id[36] = '\0';
     PQclear(r);
+    sticky_mark(out_id);
     return 0;
 }
 
 int db_user_find_by_email(const char* email, char out_id[37], char* out_hash, size_t hash_len, char* out_role, size_t role_len) {
     const char* params[1] = { email };
-    PGresult* r = PQexecParams(g_conn,
-        "select id, password_hash, role from users where email=$1 limit 1",
-        1, NULL, params, NULL, NULL, 0);
+    const char* sql = "select id, password_hash, role from users where email=$1 limit 1";
+    PGconn* c = db_for(DB_READ, NULL);
+    PGresult* r = PQexecParams(c, sql, 1, NULL, params, NULL, NULL, 0);
+    // a just-signed-up user may not have reached the replica yet, and a replica
+    // timeout or error must not turn into bad_credentials
+    if (c == g_replica && (PQresultStatus(r) != PGRES_TUPLES_OK || PQntuples(r) == 0)) {
+        PQclear(r);
+        r = PQexecParams(db_primary(DB_READ), sql, 1, NULL, params, NULL, NULL, 0);
+    }
     if (PQresultStatus(r) != PGRES_TUPLES_OK || PQntuples(r) == 0) {
         PQclear(r); return -1;
     }
@@ -70,9 +174,11 @@ int db_user_find_by_email(const char* email, char out_id[37], char* out_hash, si
     return 0;
 }
 
-int db_vehicles_list(const char* user_id, char** out_json) {
+int db_vehicles_list(const char* user_id, char** out_json, bool* out_from_primary) {
     const char* params[1] = { user_id };
-    PGresult* r = PQexecParams(g_conn,
+    PGconn* c = db_for(DB_READ, user_id);
+    *out_from_primary = c != g_replica;
+    PGresult* r = PQexecParams(c,
         "select id,year,make,model,coalesce(nickname,'') as nickname,created_at "
         "from vehicles where user_id=$1 order by created_at desc",
         1, NULL, params, NULL, NULL, 0);
@@ -98,7 +204,7 @@ int db_vehicle_insert(const char* user_id, int year, const char* make, const cha
     char uuid[37]; uuid4(uuid);
     char year_s[16]; snprintf(year_s, sizeof year_s, "%d", year);
     const char* params[6] = { uuid, user_id, year_s, make, model, nickname ? nickname : "" };
-    PGresult* r = PQexecParams(g_conn,
+    PGresult* r = PQexecParams(db_for(DB_WRITE, user_id),
         "insert into vehicles(id,user_id,year,make,model,nickname) values($1,$2,$3,$4,$5,$6) "
         "returning id,year,make,model,coalesce(nickname,'')",
         6, NULL, params, NULL, NULL, 0);
@@ -113,6 +219,88 @@ int db_vehicle_insert(const char* user_id, int year, const char* make, const cha
     snprintf(buf, cap, "{\"id\":\"%s\",\"year\":%s,\"make\":\"%s\",\"model\":\"%s\",\"nickname\":\"%s\"}",
              id, y, mk, mdl, nick);
     PQclear(r);
+    sticky_mark(user_id);
+    cache_vehicles_bump(user_id);
     *out_json = buf;
     return 0;
 }
+
+/* COPY text format: escape the delimiter, row terminator and backslash. */
+static size_t copy_escape(char* out, const char* s) {
+    size_t o = 0;
+    for (; *s; s++) {
+        switch (*s) {
+          case '\\': out[o++]='\\'; out[o++]='\\'; break;
+          case '\t':  out[o++]='\\'; out[o++]='t'; break;
+          case '\n':  out[o++]='\\'; out[o++]='n'; break;
+          case '\r':  out[o++]='\\'; out[o++]='r'; break;
+          default:    out[o++]=*s;
+        }
+    }
+    return o;
+}
+
+int db_vehicles_copy_begin(void) {
+    // id comes from the column default, so no per-row uuid4() round trip to /dev/urandom
+    PGconn* c = db_for(DB_BULK, NULL);
+    char sql[96];
+    snprintf(sql, sizeof sql, "begin; set local statement_timeout = %d", g_budget_ms[DB_BULK]);
+    PGresult* r = PQexec(c, sql);
+    int ok = PQresultStatus(r) == PGRES_COMMAND_OK;
+    PQclear(r);
+    if (!ok) { PQclear(PQexec(c, "rollback")); return -1; }
+    r = PQexec(c, "copy vehicles(user_id,year,make,model,nickname) from stdin");
+    ok = PQresultStatus(r) == PGRES_COPY_IN;
+    PQclear(r);
+    if (!ok) { PQclear(PQexec(c, "rollback")); return -1; }
+    return 0;
+}
+
+int db_vehicles_copy_row(const char* user_id, int year, const char* make, const char* model, const char* nickname) {
+    size_t cap = strlen(user_id) + 16 + 2*(strlen(make) + strlen(model) + strlen(nickname)) + 8;
+    char* line = malloc(cap); if (!line) return -1;
+    size_t off = (size_t)snprintf(line, cap, "%s\t%d\t", user_id, year);
+    off += copy_escape(line+off, make);   line[off++]='\t';
+    off += copy_escape(line+off, model);  line[off++]='\t';
+    off += copy_escape(line+off, nickname); line[off++]='\n';
+    int rc = PQputCopyData(g_conn, line, (int)off) == 1 ? 0 : -1;
+    free(line);
+    return rc;
+}
+
+int db_vehicles_copy_end(const char* user_id, bool commit, long* out_count, long* out_bad_line, char* out_err, size_t err_len) {
+    *out_bad_line = 0;
+    if (PQputCopyEnd(g_conn, commit ? NULL : "bulk import aborted") != 1) {
+        // the connection is stuck mid-COPY; every later statement would fail on it
+        PQreset(g_conn);
+        return -1;
+    }
+    int rc = commit ? 0 : -1;
+    PGresult* r;
+    while ((r = PQgetResult(g_conn)) != NULL) {
+        ExecStatusType st = PQresultStatus(r);
+        if (st == PGRES_COMMAND_OK) {
+            if (out_count) *out_count = strtol(PQcmdTuples(r), NULL, 10);
+        } else if (st == PGRES_COPY_IN) {
+            PQclear(r);
+            PQreset(g_conn);
+            return -1;
+        } else {
+            rc = -1;
+            // CONTEXT reads "COPY vehicles, line N, column ...": N is the 1-based data line
+            const char* ctx = PQresultErrorField(r, PG_DIAG_CONTEXT);
+            const char* line = ctx ? strstr(ctx, "line ") : NULL;
+            if (commit && line) {
+                *out_bad_line = strtol(line + 5, NULL, 10);
+                const char* msg = PQresultErrorField(r, PG_DIAG_MESSAGE_PRIMARY);
+                snprintf(out_err, err_len, "%s", msg ? msg : "rejected");
+            }
+        }
+        PQclear(r);
+    }
+    r = PQexec(g_conn, rc == 0 ? "commit" : "rollback");
+    if (PQresultStatus(r) != PGRES_COMMAND_OK) rc = -1;
+    PQclear(r);
+    if (rc == 0) { sticky_mark(user_id); cache_vehicles_bump(user_id); }
+    return rc;
+}
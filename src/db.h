@@ -1,6 +1,7 @@
 // src/db.h
 #pragma once
 #include <libpq-fe.h>
+#include <stdbool.h>
 
 int  db_init(void);
 void db_close(void);
@@ -11,5 +12,12 @@ int  db_user_create(const char* email, const char* password_hash, const char* ro
 int  db_user_find_by_email(const char* email, char out_id[37], char* out_hash, size_t hash_len, char* out_role, size_t role_len);
 
 /* Vehicles */
-int  db_vehicles_list(const char* user_id, char** out_json);
+/* *out_from_primary is false when the rows came from the (possibly lagging) replica. */
+int  db_vehicles_list(const char* user_id, char** out_json, bool* out_from_primary);
 int  db_vehicle_insert(const char* user_id, int year, const char* make, const char* model, const char* nickname, char** out_json);
+
+/* Bulk load: begin, one call per validated row, then end (commit=false aborts). */
+int  db_vehicles_copy_begin(void);
+int  db_vehicles_copy_row(const char* user_id, int year, const char* make, const char* model, const char* nickname);
+/* On a row rejected by Postgres, *out_bad_line is its 1-based position among copied rows. */
+int  db_vehicles_copy_end(const char* user_id, bool commit, long* out_count, long* out_bad_line, char* out_err, size_t err_len);
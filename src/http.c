@@ -7,6 +7,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
@@ -15,13 +16,18 @@ static const char* status_line(int code) {
       case 200: return "HTTP/1.1 200 OK\r\n";
       case 201: return "HTTP/1.1 201 Created\r\n";
       case 204: return "HTTP/1.1 204 No Content\r\n";
+      case 304: return "HTTP/1.1 304 Not Modified\r\n";
       case 400: return "HTTP/1.1 400 Bad Request\r\n";
       case 401: return "HTTP/1.1 401 Unauthorized\r\n";
       case 403: return "HTTP/1.1 403 Forbidden\r\n";
       case 404: return "HTTP/1.1 404 Not Found\r\n";
       case 405: return "HTTP/1.1 405 Method Not Allowed\r\n";
+      case 408: return "HTTP/1.1 408 Request Timeout\r\n";
       case 409: return "HTTP/1.1 409 Conflict\r\n";
+      case 413: return "HTTP/1.1 413 Payload Too Large\r\n";
+      case 431: return "HTTP/1.1 431 Request Header Fields Too Large\r\n";
       case 500: return "HTTP/1.1 500 Internal Server Error\r\n";
+      case 503: return "HTTP/1.1 503 Service Unavailable\r\n";
       default:  return "HTTP/1.1 200 OK\r\n";
     }
 }
@@ -54,71 +60,49 @@ static char* strnstr_local(const char* haystack, const char* needle, size_t len)
     return NULL;
 }
 
-int http_read_request(int client_fd, http_request* req, http_ctx* ctx) {
-    memset(req, 0, sizeof *req);
-    char buf[8192];
-    ssize_t n = recv(client_fd, buf, sizeof(buf)-1, 0);
-    if (n <= 0) return -1;
-    buf[n] = '\0';
+/* Parses the request line and headers from buf. Returns 0 once the blank line
+   has been seen (*out_header_len covers it), 1 if more bytes are needed and -1
+   for a malformed request. The body is left to the caller. */
+int http_parse_head(const char* buf, size_t n, http_request* req, size_t* out_header_len) {
+    // headers
+    char* header_end = strnstr_local(buf, "\r\n\r\n", n);
+    if (!header_end) return 1;
+    size_t header_len = (size_t)(header_end - buf) + 4;
 
+    memset(req, 0, sizeof *req);
     // request line
     if (sscanf(buf, "%7s %1023s", req->method, req->path) != 2) return -1;
 
-    // headers
-    char* header_end = strnstr_local(buf, "\r\n\r\n", (size_t)n);
-    if (!header_end) return -1;
-    size_t header_len = (size_t)(header_end - buf) + 4;
-
     // scan for interested headers
     const char* p = buf;
     while (p < header_end) {
         char* line_end = strnstr_local(p, "\r\n", (size_t)(header_end - p));
-        if (!line_end) break;
+        if (!line_end) line_end = header_end;
         size_t line_len = (size_t)(line_end - p);
         if (line_len >= 14 && !strncasecmp(p, "Content-Type:", 13)) {
-            size_t copy = line_len - 13;
-            while (copy && (p[13 + (line_len - 13 - copy)]==' ')) copy--;
             snprintf(req->content_type, sizeof req->content_type, "%.*s", (int)(line_len-13), p+13);
         }
-        if (line_len >= 16 && !strncasecmp(p, "Content-Length:", 15)) {
+        if (line_len >= 15 && !strncasecmp(p, "Content-Length:", 15)) {
             char tmp[32] = {0};
+            if (line_len - 15 >= sizeof tmp) return -1;
             snprintf(tmp, sizeof tmp, "%.*s", (int)(line_len-15), p+15);
-            req->content_length = (size_t)strtoul(tmp, NULL, 10);
+            char* endp = NULL;
+            errno = 0;
+            unsigned long long cl = strtoull(tmp, &endp, 10);
+            if (errno || endp == tmp || strchr(tmp, '-')) return -1;
+            while (*endp==' ' || *endp=='\t') endp++;
+            if (*endp) return -1;
+            req->content_length = (size_t)cl;
         }
         if (line_len >= 7 && !strncasecmp(p, "Cookie:", 7)) {
-            size_t copy = line_len - 7;
             snprintf(req->cookie, sizeof req->cookie, "%.*s", (int)(line_len-7), p+7);
         }
-        p = line_end + 2;
-    }
-
-    // body
-    size_t have = (size_t)n - header_len;
-    if (have < req->content_length) {
-        // read remaining
-        size_t remaining = req->content_length - have;
-        char* body = malloc(req->content_length + 1);
-        if (!body) return -1;
-        memcpy(body, buf + header_len, have);
-        size_t off = have;
-        while (remaining > 0) {
-            ssize_t r = recv(client_fd, body + off, remaining, 0);
-            if (r <= 0) { free(body); return -1; }
-            off += (size_t)r; remaining -= (size_t)r;
-        }
-        body[req->content_length] = '\0';
-        req->body = body;
-    } else {
-        // body fully present
-        if (req->content_length > 0) {
-            req->body = malloc(req->content_length + 1);
-            if (!req->body) return -1;
-            memcpy(req->body, buf + header_len, req->content_length);
-            req->body[req->content_length] = '\0';
-        } else {
-            req->body = NULL;
+        if (line_len >= 15 && !strncasecmp(p, "If-None-Match:", 14)) {
+            snprintf(req->if_none_match, sizeof req->if_none_match, "%.*s", (int)(line_len-14), p+14);
         }
+        p = line_end + 2;
     }
+    *out_header_len = header_len;
     return 0;
 }
 
@@ -127,19 +111,71 @@ void http_free_request(http_request* req) {
     memset(req, 0, sizeof *req);
 }
 
-static void send_common(http_response* res, int code, const char* content_type, const char* body) {
-    char header[256];
+void http_write(http_response* res, const char* data, size_t len) {
+    if (res->len + len > res->cap) {
+        size_t cap = res->cap ? res->cap : 1024;
+        while (cap < res->len + len) cap *= 2;
+        char* p = realloc(res->buf, cap);
+        if (!p) return;
+        res->buf = p; res->cap = cap;
+    }
+    memcpy(res->buf + res->len, data, len);
+    res->len += len;
+}
+
+void http_free_response(http_response* res) {
+    free(res->buf);
+    res->buf = NULL; res->len = res->cap = 0;
+}
+
+static void send_common(http_response* res, int code, const char* content_type, const char* extra, const char* body) {
+    char header[512];
     int n = snprintf(header, sizeof header,
         "%sContent-Type: %s\r\n"
+        "%s"
         "Connection: close\r\n"
         "Content-Length: %zu\r\n\r\n",
-        status_line(code), content_type, body ? strlen(body) : 0);
-    send(res->fd, header, n, 0);
-    if (body && *body) send(res->fd, body, strlen(body), 0);
+        status_line(code), content_type, extra ? extra : "", body ? strlen(body) : 0);
+    http_write(res, header, (size_t)n);
+    if (body && *body) http_write(res, body, strlen(body));
 }
 
 void http_send_json(http_response* res, int status_code, const char* json) {
-    send_common(res, status_code, "application/json; charset=utf-8", json ? json : "");
+    send_common(res, status_code, "application/json; charset=utf-8", NULL, json ? json : "");
+}
+
+void http_send_json_etag(http_response* res, int status_code, const char* json, const char* etag) {
+    char extra[160];
+    snprintf(extra, sizeof extra, "ETag: %s\r\nCache-Control: private, no-cache\r\n", etag);
+    send_common(res, status_code, "application/json; charset=utf-8", extra, json ? json : "");
+}
+
+void http_send_304(http_response* res, const char* etag) {
+    char header[256];
+    int n = snprintf(header, sizeof header,
+        "%sETag: %s\r\n"
+        "Cache-Control: private, no-cache\r\n"
+        "Connection: close\r\n\r\n",
+        status_line(304), etag);
+    http_write(res, header, (size_t)n);
+}
+
+/* If-None-Match uses weak comparison: W/ prefixes are ignored, "*" matches anything. */
+bool http_etag_matches(const char* if_none_match, const char* etag) {
+    size_t elen = strlen(etag);
+    const char* p = if_none_match;
+    while (*p) {
+        while (*p==' ' || *p=='\t' || *p==',') p++;
+        if (*p=='*') return true;
+        if (!strncmp(p, "W/", 2)) p += 2;
+        const char* end = p;
+        if (*end=='"') { end = strchr(end+1, '"'); end = end ? end+1 : p + strlen(p); }
+        else while (*end && *end!=',' && *end!=' ') end++;
+        if ((size_t)(end - p) == elen && !memcmp(p, etag, elen)) return true;
+        if (end == p) break;
+        p = end;
+    }
+    return false;
 }
 
 void http_send_405(http_response* res) {
@@ -149,3 +185,9 @@ void http_send_405(http_response* res) {
 void http_send_404(http_response* res) {
     http_send_json(res, 404, "{\"error\":\"not_found\"}\n");
 }
+
+void http_send_503(http_response* res, int retry_after_seconds) {
+    char extra[64];
+    snprintf(extra, sizeof extra, "Retry-After: %d\r\n", retry_after_seconds);
+    send_common(res, 503, "application/json; charset=utf-8", extra, "{\"error\":\"overloaded\"}\n");
+}
@@ -4,17 +4,24 @@
 #include <stdbool.h>
 #include <netinet/in.h>
 
+/* Largest request line + headers buffered per connection. */
+#define HTTP_MAX_HEADER_BYTES 8192
+
 typedef struct {
     char method[8];
     char path[1024];
     char content_type[128];
     char cookie[2048];
+    char if_none_match[256];
     size_t content_length;
     char* body;
 } http_request;
 
+/* Responses are buffered; the server writes them out without blocking. */
 typedef struct {
     int fd;
+    char* buf;
+    size_t len, cap;
 } http_response;
 
 typedef struct {
@@ -29,9 +36,15 @@ typedef struct {
 
 int  http_listen(int port);
 int  http_accept(int server_fd, struct sockaddr_in* client_addr);
-int  http_read_request(int client_fd, http_request* req, http_ctx* ctx);
+int  http_parse_head(const char* buf, size_t len, http_request* req, size_t* out_header_len);
 void http_free_request(http_request* req);
+void http_write(http_response* res, const char* data, size_t len);
+void http_free_response(http_response* res);
 
 void http_send_json(http_response* res, int status_code, const char* json);
+void http_send_json_etag(http_response* res, int status_code, const char* json, const char* etag);
+void http_send_304(http_response* res, const char* etag);
+bool http_etag_matches(const char* if_none_match, const char* etag);
 void http_send_405(http_response* res);
 void http_send_404(http_response* res);
+void http_send_503(http_response* res, int retry_after_seconds);
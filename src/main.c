@@ -1,12 +1,12 @@
 // src/main.c
 #define _POSIX_C_SOURCE 200809L
 #include "http.h"
+#include "server.h"
 #include "db.h"
 #include "sessions.h"
 #include "auth.h"
 #include "vehicles.h"
-#include "util.h"
-#include <arpa/inet.h>
+#include "cache.h"
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -37,10 +37,20 @@ static void route_request(const http_ctx* ctx, http_request* req, http_response*
         return handle_vehicles_list(ctx,req,res);
     if (!strcmp(req->path,"/api/vehicles") && !strcmp(req->method,"POST"))
         return handle_vehicles_create(ctx,req,res);
+    if (!strcmp(req->path,"/api/vehicles/bulk"))
+        return handle_vehicles_bulk(ctx,req,res);
 
     http_send_404(res);
 }
 
+static server_prio route_priority(const http_request* req) {
+    if (!strcmp(req->path,"/api/health")) return PRIO_HEALTH;
+    if (!strncmp(req->path,"/api/me",7) || !strncmp(req->path,"/api/logout",11)) return PRIO_SESSION;
+    if (!strcmp(req->path,"/api/vehicles")) return PRIO_VEHICLES;
+    if (!strncmp(req->path,"/api/signup",11) || !strncmp(req->path,"/api/login",10)) return PRIO_AUTH;
+    return PRIO_SEARCH;  // bulk import, future searches, unknown paths
+}
+
 int main(void) {
     if (sodium_init() < 0) {
         fprintf(stderr,"libsodium init failed\n"); return 1;
@@ -50,6 +60,8 @@ int main(void) {
 
     if (db_init()!=0) { fprintf(stderr,"db_init failed\n"); return 1; }
     if (sessions_init()!=0) { fprintf(stderr,"sessions_init failed\n"); return 1; }
+    cache_init();
+    vehicles_init();
 
     int server_fd = http_listen(port);
     if (server_fd < 0) { perror("listen"); return 1; }
@@ -57,21 +69,9 @@ int main(void) {
 
     signal(SIGINT, handle_sigint);
     signal(SIGTERM, handle_sigint);
+    signal(SIGPIPE, SIG_IGN);  // a client that hangs up mid-response must not kill the server
 
-    while (keep_running) {
-        struct sockaddr_in client_addr;
-        int cfd = http_accept(server_fd, &client_addr);
-        if (cfd < 0) { if (!keep_running) break; continue; }
-        http_request req; http_response res = {.fd=cfd}; http_ctx ctx = {0};
-        inet_ntop(AF_INET, &client_addr.sin_addr, ctx.remote_ip, sizeof ctx.remote_ip);
-        uuid4(ctx.request_id);
-
-        if (http_read_request(cfd, &req, &ctx)==0) {
-            route_request(&ctx, &req, &res);
-            http_free_request(&req);
-        }
-        close(cfd);
-    }
+    if (server_run(server_fd, route_request, route_priority, &keep_running) != 0) { perror("server"); return 1; }
 
     sessions_close();
     db_close();
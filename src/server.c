@@ -0,0 +1,384 @@
+// src/server.c
+#define _POSIX_C_SOURCE 200809L
+#include "server.h"
+#include "timer.h"
+#include "util.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Connections are read on a non-blocking epoll loop so one slow client cannot
+ * stall the others. Each connection has a phase deadline (headers, then body)
+ * and an idle deadline reset by every read, both on a timer wheel. Handlers
+ * write into a buffer that the loop flushes on EPOLLOUT under a write
+ * deadline, so a client that stops reading only costs its own connection.
+ *
+ * Complete requests wait in per-priority FIFOs and one is run per loop turn,
+ * after new input has been read, so cheap high-priority requests overtake
+ * queued expensive ones. Admission is CoDel-style: once the oldest queued
+ * request has waited longer than the target for a whole interval, the lowest
+ * class still being served is shed with 503, both from the queue and for new
+ * requests as soon as their headers are parsed. Every further interval over
+ * target sheds one more class. Each interval back under target restores one.
+ */
+
+#define TICK_MS 10
+/* Lingering close after answering a request whose input was not fully read:
+   closing with unread bytes sends an RST that can destroy the response. */
+#define LINGER_MS 2000
+
+typedef enum { CONN_HEAD, CONN_BODY, CONN_QUEUED, CONN_WRITE, CONN_DRAIN } conn_state;
+
+typedef struct conn {
+    struct conn* next;
+    struct conn* prev;
+    int fd;
+    conn_state state;
+    char head[HTTP_MAX_HEADER_BYTES + 1];
+    size_t head_len;
+    http_request req;
+    size_t body_have;
+    http_ctx ctx;
+    http_response res;
+    size_t res_off;
+    bool linger;         /* input may be unread: drain it before closing */
+    size_t drained;
+    timer_entry deadline;
+    timer_entry idle;
+    struct conn* next_ready;
+    server_prio prio;
+    uint64_t ready_at;  /* ms */
+} conn;
+
+static struct {
+    int max_conns;
+    size_t max_body;
+    int header_ms, body_ms, idle_ms, write_ms;
+    int target_ms, interval_ms;
+} cfg;
+
+static struct {
+    conn* head[PRIO_CLASSES];
+    conn* tail[PRIO_CLASSES];
+    int count;
+} g_ready;
+
+static struct {
+    uint64_t first_above;  /* when the delay may first be judged persistent, 0 = under target */
+    uint64_t next_relax;
+    int shed_from;         /* classes >= shed_from get 503; PRIO_CLASSES = none */
+} g_overload;
+
+static timer_wheel g_tw;
+static int g_epfd = -1;
+static int g_listen_fd = -1;
+static int g_nconns = 0;
+static int g_accept_paused = 0;
+static conn g_conns;  /* list head */
+static server_handler g_handler;
+static server_classifier g_classify;
+
+static int getenv_int_or(const char* k, int def){const char* v=getenv(k);if(!v||!*v)return def;return atoi(v);}
+
+static uint64_t now_ms(void) {
+    struct timespec ts; clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000 + (uint64_t)ts.tv_nsec/1000000;
+}
+
+static uint64_t now_ticks(void) { return now_ms() / TICK_MS; }
+
+/* From the real clock: g_tw.now lags behind after an idle wait or a slow handler.
+   (Advancing the wheel before handling events instead could free a connection
+   that still has an event pending in the same epoll batch.) */
+static uint64_t ticks_from_now(int ms) { return now_ticks() + (uint64_t)(ms + TICK_MS - 1) / TICK_MS; }
+
+static void set_accept_paused(int paused) {
+    if (paused == g_accept_paused) return;
+    struct epoll_event ev = { .events = paused ? 0 : EPOLLIN, .data.ptr = NULL };
+    epoll_ctl(g_epfd, EPOLL_CTL_MOD, g_listen_fd, &ev);
+    g_accept_paused = paused;
+}
+
+static void conn_close(conn* c) {
+    timer_cancel(&g_tw, &c->deadline);
+    timer_cancel(&g_tw, &c->idle);
+    c->prev->next = c->next; c->next->prev = c->prev;
+    close(c->fd);  // also drops it from the epoll set
+    http_free_request(&c->req);
+    http_free_response(&c->res);
+    free(c);
+    g_nconns--;
+    if (g_nconns < cfg.max_conns) set_accept_paused(0);
+}
+
+static void conn_flush(conn* c) {
+    while (c->res_off < c->res.len) {
+        ssize_t n = send(c->fd, c->res.buf + c->res_off, c->res.len - c->res_off, MSG_NOSIGNAL);
+        if (n > 0) { c->res_off += (size_t)n; continue; }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;  // wait for EPOLLOUT
+        return conn_close(c);
+    }
+    if (!c->linger) return conn_close(c);
+    // response is out: stop sending and read (and discard) what the client still sends
+    shutdown(c->fd, SHUT_WR);
+    c->state = CONN_DRAIN;
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = c };
+    epoll_ctl(g_epfd, EPOLL_CTL_MOD, c->fd, &ev);
+    timer_arm(&g_tw, &c->deadline, ticks_from_now(LINGER_MS));
+}
+
+static void conn_drain(conn* c) {
+    char buf[16384];
+    for (;;) {
+        ssize_t n = recv(c->fd, buf, sizeof buf, 0);
+        if (n > 0) {
+            c->drained += (size_t)n;
+            if (c->drained > cfg.max_body) return conn_close(c);
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+        return conn_close(c);  // EOF: the client saw the response and hung up
+    }
+}
+
+/* Response is buffered in c->res: write it out without blocking the loop. */
+static void conn_write(conn* c) {
+    timer_cancel(&g_tw, &c->idle);
+    c->state = CONN_WRITE;
+    struct epoll_event ev = { .events = EPOLLOUT, .data.ptr = c };
+    // queued connections were removed from the set, failed reads are still in it
+    if (epoll_ctl(g_epfd, EPOLL_CTL_MOD, c->fd, &ev) < 0 && errno == ENOENT)
+        epoll_ctl(g_epfd, EPOLL_CTL_ADD, c->fd, &ev);
+    timer_arm(&g_tw, &c->deadline, ticks_from_now(cfg.write_ms));
+    conn_flush(c);
+}
+
+/* Error before the request was fully read. */
+static void conn_fail(conn* c, int code, const char* json) {
+    c->linger = true;
+    http_send_json(&c->res, code, json);
+    conn_write(c);
+}
+
+static void on_deadline(void* arg) {
+    conn* c = arg;
+    if (c->state == CONN_WRITE || c->state == CONN_DRAIN) return conn_close(c);
+    conn_fail(c, 408, "{\"error\":\"request_timeout\"}\n");
+}
+
+/* Request fully read: stop watching the socket and queue it by priority. */
+static void conn_ready(conn* c) {
+    timer_cancel(&g_tw, &c->deadline);
+    timer_cancel(&g_tw, &c->idle);
+    epoll_ctl(g_epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    c->state = CONN_QUEUED;
+    c->ready_at = now_ms();
+    c->next_ready = NULL;
+    if (g_ready.tail[c->prio]) g_ready.tail[c->prio]->next_ready = c;
+    else g_ready.head[c->prio] = c;
+    g_ready.tail[c->prio] = c;
+    g_ready.count++;
+}
+
+static conn* ready_pop(int prio) {
+    conn* c = g_ready.head[prio];
+    if (!c) return NULL;
+    g_ready.head[prio] = c->next_ready;
+    if (!g_ready.head[prio]) g_ready.tail[prio] = NULL;
+    g_ready.count--;
+    return c;
+}
+
+/* Sojourn of the oldest queued request; each FIFO head is its class's oldest. */
+static uint64_t queue_delay(uint64_t now) {
+    uint64_t oldest = now;
+    for (int p = 0; p < PRIO_CLASSES; p++)
+        if (g_ready.head[p] && g_ready.head[p]->ready_at < oldest) oldest = g_ready.head[p]->ready_at;
+    return now - oldest;
+}
+
+static void overload_update(uint64_t now) {
+    int before = g_overload.shed_from;
+    if (queue_delay(now) < (uint64_t)cfg.target_ms) {
+        g_overload.first_above = 0;
+        // catch up on intervals that passed while the queue sat empty
+        while (g_overload.shed_from < PRIO_CLASSES && now >= g_overload.next_relax) {
+            g_overload.shed_from++;
+            g_overload.next_relax += (uint64_t)cfg.interval_ms;
+        }
+    } else if (!g_overload.first_above) {
+        g_overload.first_above = now + (uint64_t)cfg.interval_ms;
+    } else if (now >= g_overload.first_above) {
+        if (g_overload.shed_from > PRIO_HEALTH + 1) g_overload.shed_from--;
+        g_overload.first_above = now + (uint64_t)cfg.interval_ms;
+        g_overload.next_relax = now + (uint64_t)cfg.interval_ms;
+    }
+    if (g_overload.shed_from != before)
+        fprintf(stderr, "overload: shedding priority classes >= %d of %d\n", g_overload.shed_from, PRIO_CLASSES);
+}
+
+static void shed_queued(void) {
+    for (int p = g_overload.shed_from; p < PRIO_CLASSES; p++) {
+        conn* c;
+        while ((c = ready_pop(p)) != NULL) {
+            http_send_503(&c->res, 1);
+            conn_write(c);
+        }
+    }
+}
+
+static void conn_dispatch(conn* c) {
+    g_handler(&c->ctx, &c->req, &c->res);
+    conn_write(c);
+}
+
+static void on_accept(void) {
+    while (g_nconns < cfg.max_conns) {
+        struct sockaddr_in client_addr;
+        int fd = http_accept(g_listen_fd, &client_addr);
+        if (fd < 0) return;
+        conn* c = calloc(1, sizeof *c);
+        if (!c) { close(fd); return; }
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+        c->fd = fd;
+        c->res.fd = fd;
+        c->state = CONN_HEAD;
+        inet_ntop(AF_INET, &client_addr.sin_addr, c->ctx.remote_ip, sizeof c->ctx.remote_ip);
+        uuid4(c->ctx.request_id);
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = c };
+        if (epoll_ctl(g_epfd, EPOLL_CTL_ADD, fd, &ev) < 0) { close(fd); free(c); continue; }
+        c->next = g_conns.next; c->prev = &g_conns;
+        g_conns.next->prev = c; g_conns.next = c;
+        g_nconns++;
+        timer_entry_init(&c->deadline, on_deadline, c);
+        timer_entry_init(&c->idle, on_deadline, c);
+        timer_arm(&g_tw, &c->deadline, ticks_from_now(cfg.header_ms));
+        timer_arm(&g_tw, &c->idle, ticks_from_now(cfg.idle_ms));
+    }
+    set_accept_paused(1);
+}
+
+/* Headers are complete: size-check the body and copy whatever arrived with them. */
+static int conn_start_body(conn* c, size_t header_len) {
+    size_t cl = c->req.content_length;
+    if (cl > cfg.max_body) { conn_fail(c, 413, "{\"error\":\"payload_too_large\"}\n"); return -1; }
+    if (cl == 0) return 1;
+    c->req.body = malloc(cl + 1);
+    if (!c->req.body) { conn_fail(c, 500, "{\"error\":\"oom\"}\n"); return -1; }
+    size_t extra = c->head_len - header_len;
+    c->body_have = extra < cl ? extra : cl;
+    memcpy(c->req.body, c->head + header_len, c->body_have);
+    c->req.body[cl] = '\0';
+    if (c->body_have == cl) return 1;
+    c->state = CONN_BODY;
+    timer_arm(&g_tw, &c->deadline, ticks_from_now(cfg.body_ms));
+    return 0;
+}
+
+static int head_complete(const char* p, size_t n) {
+    for (size_t i = 0; i + 4 <= n; i++)
+        if (p[i]=='\r' && !memcmp(p + i, "\r\n\r\n", 4)) return 1;
+    return 0;
+}
+
+static void on_readable(conn* c) {
+    char* dst; size_t room;
+    if (c->state == CONN_HEAD) { dst = c->head + c->head_len; room = HTTP_MAX_HEADER_BYTES - c->head_len; }
+    else { dst = c->req.body + c->body_have; room = c->req.content_length - c->body_have; }
+    size_t scan_from = c->head_len > 3 ? c->head_len - 3 : 0;
+    ssize_t n = recv(c->fd, dst, room, 0);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return;
+    if (n <= 0) return conn_close(c);
+    timer_arm(&g_tw, &c->idle, ticks_from_now(cfg.idle_ms));
+
+    if (c->state == CONN_BODY) {
+        c->body_have += (size_t)n;
+        if (c->body_have == c->req.content_length) conn_ready(c);
+        return;
+    }
+    c->head_len += (size_t)n;
+    c->head[c->head_len] = '\0';
+    // only the new bytes (plus 3 for a split terminator) can complete the head
+    if (!head_complete(c->head + scan_from, c->head_len - scan_from)) {
+        if (c->head_len == HTTP_MAX_HEADER_BYTES) conn_fail(c, 431, "{\"error\":\"headers_too_large\"}\n");
+        return;
+    }
+    size_t header_len = 0;
+    if (http_parse_head(c->head, c->head_len, &c->req, &header_len) != 0)
+        return conn_fail(c, 400, "{\"error\":\"bad_request\"}\n");
+    // admission happens before the body is allocated or read
+    c->prio = g_classify(&c->req);
+    if (c->prio >= PRIO_CLASSES) c->prio = PRIO_CLASSES - 1;
+    overload_update(now_ms());
+    if ((int)c->prio >= g_overload.shed_from) {
+        c->linger = true;
+        http_send_503(&c->res, 1);
+        return conn_write(c);
+    }
+    if (conn_start_body(c, header_len) > 0) conn_ready(c);
+}
+
+/* Runs the highest-priority queued request, after shedding what overload control rejects. */
+static void dispatch_next(void) {
+    overload_update(now_ms());
+    shed_queued();
+    for (int p = 0; p < PRIO_CLASSES; p++) {
+        conn* c = ready_pop(p);
+        if (c) return conn_dispatch(c);
+    }
+}
+
+int server_run(int server_fd, server_handler handler, server_classifier classify, volatile sig_atomic_t* keep_running) {
+    cfg.max_conns = getenv_int_or("MAX_CONNECTIONS", 256);
+    cfg.max_body  = (size_t)getenv_int_or("MAX_BODY_BYTES", 8*1024*1024);
+    cfg.header_ms = getenv_int_or("HEADER_TIMEOUT_MS", 10000);
+    cfg.body_ms   = getenv_int_or("BODY_TIMEOUT_MS", 30000);
+    cfg.idle_ms   = getenv_int_or("IDLE_TIMEOUT_MS", 5000);
+    cfg.write_ms  = getenv_int_or("WRITE_TIMEOUT_MS", 10000);
+    cfg.target_ms   = getenv_int_or("OVERLOAD_TARGET_MS", 50);
+    cfg.interval_ms = getenv_int_or("OVERLOAD_INTERVAL_MS", 500);
+    g_overload.shed_from = PRIO_CLASSES;
+
+    g_handler = handler;
+    g_classify = classify;
+    g_listen_fd = server_fd;
+    g_conns.next = g_conns.prev = &g_conns;
+    timer_wheel_init(&g_tw, now_ticks());
+
+    fcntl(server_fd, F_SETFL, fcntl(server_fd, F_GETFL, 0) | O_NONBLOCK);
+    g_epfd = epoll_create1(0);
+    if (g_epfd < 0) return -1;
+    struct epoll_event lev = { .events = EPOLLIN, .data.ptr = NULL };
+    if (epoll_ctl(g_epfd, EPOLL_CTL_ADD, server_fd, &lev) < 0) { close(g_epfd); return -1; }
+
+    struct epoll_event evs[64];
+    while (*keep_running) {
+        // with work queued, only poll: new requests must be able to overtake it
+        int n = epoll_wait(g_epfd, evs, 64, g_ready.count ? 0 : g_tw.count ? TICK_MS : -1);
+        if (n < 0 && errno != EINTR) { perror("epoll_wait"); break; }
+        for (int i = 0; i < n; i++) {
+            if (!evs[i].data.ptr) on_accept();
+            else if (((conn*)evs[i].data.ptr)->state == CONN_WRITE) conn_flush(evs[i].data.ptr);
+            else if (((conn*)evs[i].data.ptr)->state == CONN_DRAIN) conn_drain(evs[i].data.ptr);
+            else on_readable(evs[i].data.ptr);
+        }
+        timer_advance(&g_tw, now_ticks());
+        if (g_ready.count) dispatch_next();
+    }
+
+    while (g_conns.next != &g_conns) conn_close(g_conns.next);
+    memset(&g_ready, 0, sizeof g_ready);
+    close(g_epfd);
+    g_epfd = -1;
+    return 0;
+}
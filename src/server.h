@@ -0,0 +1,20 @@
+// src/server.h
+#pragma once
+#include "http.h"
+#include <signal.h>
+
+/* Priority classes, highest first. Under overload the lowest classes are shed
+   with 503 first; PRIO_HEALTH is never shed. */
+typedef enum {
+    PRIO_HEALTH,
+    PRIO_SESSION,   /* session reads: /api/me, /api/logout */
+    PRIO_VEHICLES,  /* vehicle CRUD */
+    PRIO_AUTH,      /* signup/login: Argon2id hashing */
+    PRIO_SEARCH,    /* searches and other batch work */
+    PRIO_CLASSES
+} server_prio;
+
+typedef void (*server_handler)(const http_ctx* ctx, http_request* req, http_response* res);
+typedef server_prio (*server_classifier)(const http_request* req);
+
+int server_run(int server_fd, server_handler handler, server_classifier classify, volatile sig_atomic_t* keep_running);
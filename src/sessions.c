@@ -37,6 +37,8 @@ void sessions_close(void) {
     rc = NULL;
 }
 
+redisContext* sessions_conn(void) { return rc; }
+
 bool sessions_create(const char* user_id, char out_session_id[37], int ttl_seconds) {
     if (!rc) return false;
     char sid[37]; uuid4(sid);
@@ -0,0 +1,93 @@
+// src/timer.c
+#include "timer.h"
+
+#define LEVEL_BITS 6
+
+static void list_init(timer_entry* head) { head->next = head->prev = head; }
+
+static void list_add(timer_entry* head, timer_entry* t) {
+    t->prev = head->prev; t->next = head;
+    head->prev->next = t; head->prev = t;
+}
+
+static void list_del(timer_entry* t) {
+    t->prev->next = t->next; t->next->prev = t->prev;
+    t->next = t->prev = NULL;
+}
+
+/* Requires t->expires >= tw->now. Deltas beyond the top level are clamped,
+   so such timers fire early at the top level's horizon. */
+static void place(timer_wheel* tw, timer_entry* t) {
+    uint64_t max = ((uint64_t)1 << (LEVEL_BITS*TIMER_LEVELS)) - 1;
+    if (t->expires - tw->now > max) t->expires = tw->now + max;
+    uint64_t delta = t->expires - tw->now;
+    int level = 0;
+    while (level < TIMER_LEVELS-1 && delta >= ((uint64_t)1 << (LEVEL_BITS*(level+1)))) level++;
+    size_t slot = (size_t)(t->expires >> (LEVEL_BITS*level)) & (TIMER_SLOTS-1);
+    list_add(&tw->slots[level][slot], t);
+}
+
+void timer_wheel_init(timer_wheel* tw, uint64_t now) {
+    tw->now = now; tw->count = 0;
+    for (int l=0; l<TIMER_LEVELS; l++)
+        for (int s=0; s<TIMER_SLOTS; s++) list_init(&tw->slots[l][s]);
+}
+
+void timer_entry_init(timer_entry* t, void (*fn)(void* arg), void* arg) {
+    t->next = t->prev = NULL; t->expires = 0; t->fn = fn; t->arg = arg;
+}
+
+bool timer_pending(const timer_entry* t) { return t->next != NULL; }
+
+void timer_arm(timer_wheel* tw, timer_entry* t, uint64_t expires) {
+    if (timer_pending(t)) timer_cancel(tw, t);
+    // the slot for tw->now has already been run
+    t->expires = expires > tw->now ? expires : tw->now + 1;
+    place(tw, t);
+    tw->count++;
+}
+
+void timer_cancel(timer_wheel* tw, timer_entry* t) {
+    if (!timer_pending(t)) return;
+    list_del(t);
+    tw->count--;
+}
+
+static void cascade(timer_wheel* tw, int level) {
+    size_t slot = (size_t)(tw->now >> (LEVEL_BITS*level)) & (TIMER_SLOTS-1);
+    timer_entry* head = &tw->slots[level][slot];
+    timer_entry tmp; list_init(&tmp);
+    if (head->next == head) return;
+    tmp.next = head->next; tmp.prev = head->prev;
+    tmp.next->prev = &tmp; tmp.prev->next = &tmp;
+    list_init(head);
+    while (tmp.next != &tmp) {
+        timer_entry* t = tmp.next;
+        list_del(t);
+        place(tw, t);
+    }
+}
+
+void timer_advance(timer_wheel* tw, uint64_t now) {
+    if (!tw->count && now > tw->now) { tw->now = now; return; }
+    while (tw->now < now) {
+        tw->now++;
+        for (int l=1; l<TIMER_LEVELS; l++) {
+            if (tw->now & ((1u << (LEVEL_BITS*l)) - 1)) break;
+            cascade(tw, l);
+        }
+        // detach the due slot first so callbacks may arm/cancel freely
+        timer_entry* head = &tw->slots[0][tw->now & (TIMER_SLOTS-1)];
+        if (head->next == head) continue;
+        timer_entry due; list_init(&due);
+        due.next = head->next; due.prev = head->prev;
+        due.next->prev = &due; due.prev->next = &due;
+        list_init(head);
+        while (due.next != &due) {
+            timer_entry* t = due.next;
+            list_del(t);
+            tw->count--;
+            t->fn(t->arg);
+        }
+    }
+}
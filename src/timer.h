@@ -0,0 +1,31 @@
+// src/timer.h
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Hierarchical timer wheel: 4 levels x 64 slots, O(1) arm/cancel.
+   Times are in ticks; the caller decides the tick length. */
+#define TIMER_LEVELS 4
+#define TIMER_SLOTS  64
+
+typedef struct timer_entry {
+    struct timer_entry* next;
+    struct timer_entry* prev;
+    uint64_t expires;
+    void (*fn)(void* arg);
+    void* arg;
+} timer_entry;
+
+typedef struct {
+    uint64_t now;
+    size_t count;
+    timer_entry slots[TIMER_LEVELS][TIMER_SLOTS];  /* list heads */
+} timer_wheel;
+
+void timer_wheel_init(timer_wheel* tw, uint64_t now);
+void timer_entry_init(timer_entry* t, void (*fn)(void* arg), void* arg);
+void timer_arm(timer_wheel* tw, timer_entry* t, uint64_t expires);
+void timer_cancel(timer_wheel* tw, timer_entry* t);
+bool timer_pending(const timer_entry* t);
+void timer_advance(timer_wheel* tw, uint64_t now);
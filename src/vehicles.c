@@ -4,8 +4,10 @@
 #include "sessions.h"
 #include "json.h"
 #include "db.h"
+#include "cache.h"
 #include <jansson.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 static int get_user_from_cookie(http_request* req, char out_uid[37]) {
@@ -27,9 +29,16 @@ void handle_vehicles_list(const http_ctx* ctx, http_request* req, http_response*
     if (strcmp(req->method,"GET")) return http_send_405(res);
     char uid[37]={0};
     if (get_user_from_cookie(req, uid)!=0) return http_send_json(res,401,"{\"error\":\"unauthorized\"}\n");
-    char* json = NULL;
-    if (db_vehicles_list(uid, &json)!=0) return http_send_json(res,500,"{\"error\":\"db_error\"}\n");
-    http_send_json(res,200,json);
+    char* json = NULL; char etag[CACHE_ETAG_LEN]; long long ver = -1;
+    if (cache_vehicles_get(uid, &ver, &json, etag)!=0) {
+        bool from_primary = true;
+        if (db_vehicles_list(uid, &json, &from_primary)!=0) return http_send_json(res,500,"{\"error\":\"db_error\"}\n");
+        cache_etag_for(json, strlen(json), etag);
+        // replica rows may lag an earlier write; caching them would outlive the lag
+        if (from_primary) cache_vehicles_put(uid, ver, json, etag);
+    }
+    if (req->if_none_match[0] && http_etag_matches(req->if_none_match, etag)) http_send_304(res, etag);
+    else http_send_json_etag(res,200,json,etag);
     free(json);
 }
 
@@ -54,3 +63,130 @@ void handle_vehicles_create(const http_ctx* ctx, http_request* req, http_respons
     http_send_json(res,201,out);
     free(out);
 }
+
+/* Bulk import: body is a JSON array of vehicle objects or NDJSON (one object per line).
+   Valid rows are streamed into a single COPY; invalid ones are reported by index. */
+typedef struct {
+    const char* uid;
+    bool copying;
+    bool failed;
+    long rows;
+    long* copied; size_t ncopied, copied_cap;  /* input row index of each COPY line */
+    char* errors; size_t err_len, err_cap;
+} bulk_state;
+
+static long MAX_ROWS = 5000;
+
+void vehicles_init(void) {
+    const char* v = getenv("VEHICLES_BULK_MAX_ROWS");
+    if (v && *v) MAX_ROWS = atol(v);
+}
+
+/* detail, if any, is already JSON-encoded */
+static void bulk_error_detail(bulk_state* st, long row, const char* code, const char* detail) {
+    size_t need = 64 + (detail ? strlen(detail) + 12 : 0);
+    if (st->err_len + need > st->err_cap) {
+        size_t cap = st->err_cap ? st->err_cap*2 : 1024;
+        while (cap < st->err_len + need) cap *= 2;
+        char* p = realloc(st->errors, cap); if (!p) return;
+        st->errors = p; st->err_cap = cap;
+    }
+    st->err_len += snprintf(st->errors + st->err_len, st->err_cap - st->err_len,
+        "%s{\"row\":%ld,\"error\":\"%s\"%s%s}", st->err_len ? "," : "", row, code,
+        detail ? ",\"detail\":" : "", detail ? detail : "");
+}
+
+static void bulk_error(bulk_state* st, long row, const char* code) { bulk_error_detail(st, row, code, NULL); }
+
+static void bulk_row(bulk_state* st, json_t* obj) {
+    long row = st->rows++;
+    if (!obj || !json_is_object(obj)) return bulk_error(st, row, "invalid_json");
+    int year=0; const char* make=NULL; const char* model=NULL; const char* nickname="";
+    if (json_get_int(obj,"year",&year)!=0 || year<1900 || year>2100 ||
+        !(make=json_get_string(obj,"make")) || !*make ||
+        !(model=json_get_string(obj,"model")) || !*model) {
+        return bulk_error(st, row, "invalid_input");
+    }
+    const char* nn = json_get_string(obj,"nickname");
+    if (nn) nickname = nn;
+    if (!st->copying) {
+        if (db_vehicles_copy_begin()!=0) { st->failed = true; return; }
+        st->copying = true;
+    }
+    if (st->ncopied == st->copied_cap) {
+        size_t cap = st->copied_cap ? st->copied_cap*2 : 256;
+        long* p = realloc(st->copied, cap * sizeof *p);
+        if (!p) { st->failed = true; return; }
+        st->copied = p; st->copied_cap = cap;
+    }
+    st->copied[st->ncopied++] = row;
+    if (db_vehicles_copy_row(st->uid, year, make, model, nickname)!=0) st->failed = true;
+}
+
+void handle_vehicles_bulk(const http_ctx* ctx, http_request* req, http_response* res) {
+    (void)ctx;
+    if (strcmp(req->method,"POST")) return http_send_405(res);
+    char uid[37]={0};
+    if (get_user_from_cookie(req, uid)!=0) return http_send_json(res,401,"{\"error\":\"unauthorized\"}\n");
+    if (!req->body) return http_send_json(res,400,"{\"error\":\"invalid_json\"}\n");
+
+    const char* p = req->body;
+    while (*p==' '||*p=='\t'||*p=='\r'||*p=='\n') p++;
+    bool ndjson = strstr(req->content_type, "ndjson") != NULL || *p != '[';
+    long max_rows = MAX_ROWS;
+    bulk_state st = { .uid = uid };
+
+    if (!ndjson) {
+        json_t* root = json_parse_strict(req->body);
+        if (!root || !json_is_array(root)) { json_decref(root); return http_send_json(res,400,"{\"error\":\"invalid_json\"}\n"); }
+        if ((long)json_array_size(root) > max_rows) { json_decref(root); return http_send_json(res,413,"{\"error\":\"too_many_rows\"}\n"); }
+        size_t i; json_t* v;
+        json_array_foreach(root, i, v) {
+            if (st.failed) break;
+            bulk_row(&st, v);
+        }
+        json_decref(root);
+    } else {
+        const char* line = req->body;
+        while (*line && !st.failed) {
+            const char* end = strchr(line, '\n');
+            size_t len = end ? (size_t)(end - line) : strlen(line);
+            size_t t = len;
+            while (t && (line[t-1]=='\r'||line[t-1]==' '||line[t-1]=='\t')) t--;
+            if (t) {
+                if (st.rows >= max_rows) { st.failed = true; st.rows = max_rows + 1; break; }
+                json_error_t err;
+                json_t* obj = json_loadb(line, t, JSON_REJECT_DUPLICATES, &err);
+                bulk_row(&st, obj);
+                if (obj) json_decref(obj);
+            }
+            line = end ? end + 1 : line + len;
+        }
+    }
+
+    long inserted = 0, bad_line = 0;
+    char db_err[256] = {0};
+    int rc = 0;
+    if (st.copying) rc = db_vehicles_copy_end(uid, !st.failed, &inserted, &bad_line, db_err, sizeof db_err);
+    if (st.rows > max_rows) { free(st.copied); free(st.errors); return http_send_json(res,413,"{\"error\":\"too_many_rows\"}\n"); }
+    if (rc!=0 && !st.failed && bad_line >= 1 && (size_t)bad_line <= st.ncopied) {
+        // COPY is all-or-nothing: report the row Postgres rejected, nothing was inserted
+        json_t* s = json_string(db_err);
+        char* detail = s ? json_dumps(s, JSON_ENCODE_ANY) : NULL;
+        bulk_error_detail(&st, st.copied[bad_line-1], "db_rejected", detail);
+        free(detail); json_decref(s);
+        inserted = 0;
+    } else if (st.failed || rc!=0) {
+        free(st.copied); free(st.errors);
+        return http_send_json(res,500,"{\"error\":\"db_error\"}\n");
+    }
+    free(st.copied);
+
+    size_t cap = 64 + st.err_len;
+    char* body = malloc(cap);
+    if (!body) { free(st.errors); return http_send_json(res,500,"{\"error\":\"oom\"}\n"); }
+    snprintf(body, cap, "{\"inserted\":%ld,\"errors\":[%s]}\n", inserted, st.errors ? st.errors : "");
+    http_send_json(res, inserted > 0 ? 201 : 400, body);
+    free(body);
+    free(st.errors);
+}
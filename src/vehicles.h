@@ -2,5 +2,8 @@
 #pragma once
 #include "http.h"
 
+void vehicles_init(void);
+
 void handle_vehicles_list(const http_ctx* ctx, http_request* req, http_response* res);
 void handle_vehicles_create(const http_ctx* ctx, http_request* req, http_response* res);
+void handle_vehicles_bulk(const http_ctx* ctx, http_request* req, http_response* res);